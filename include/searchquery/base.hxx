@@ -236,6 +236,41 @@ inline std::optional<node_t> parse_expression(const std::vector<token_t>& tokens
   return *stack[0];
 }
 
+typedef struct _match_span_t {
+  size_t term_id;
+  size_t begin;
+  size_t end;
+} match_span_t;
+
+typedef struct _snippet_t {
+  size_t begin;
+  size_t end;
+} snippet_t;
+
+// Find an already lowercased phrase in content starting at pos, ignoring the
+// case of content so that offsets refer to it as given.
+inline size_t find_term(const std::string& content, const std::string& phrase_lower, size_t pos = 0) {
+  if (pos > content.size()) {
+    return std::string::npos;
+  }
+  auto it = std::search(content.begin() + pos, content.end(),
+      phrase_lower.begin(), phrase_lower.end(),
+      [](char c, char p) {
+        return static_cast<char>(std::tolower(static_cast<unsigned char>(c))) == p;
+      });
+  if (it == content.end() && !phrase_lower.empty()) {
+    return std::string::npos;
+  }
+  return static_cast<size_t>(it - content.begin());
+}
+
+inline size_t count_terms(const node_t& node) {
+  if (node.type == NODE_TERM) {
+    return 1;
+  }
+  return count_terms(*node.left) + count_terms(*node.right);
+}
+
 inline bool eval(const node_t& node, const std::string& content) {
   switch (node.type) {
     case NODE_TERM: {
@@ -277,6 +312,163 @@ inline bool match_expression(std::string content, std::string query, std::string
   return eval(*node, content_lower);
 }
 
+// Evaluate node like eval() and collect the spans of every term occurrence
+// that took part in the match. Term ids number the terms of the query from
+// left to right, starting at 0. At most capacity spans are written to spans;
+// count receives the total number found, so count > capacity means the
+// output was truncated. Spans of branches that did not match are discarded.
+// content does not need to be lowercased, and offsets refer to it as given.
+inline bool eval_with_offsets(const node_t& node, const std::string& content,
+    match_span_t* spans, size_t capacity, size_t& count, size_t& term_id) {
+  switch (node.type) {
+    case NODE_TERM: {
+      auto id = term_id++;
+      std::string term_lower = node.phrase;
+      std::transform(term_lower.begin(), term_lower.end(), term_lower.begin(),
+          [](unsigned char c){ return std::tolower(c); });
+      auto pos = find_term(content, term_lower);
+      if (pos == std::string::npos) {
+        return false;
+      }
+      auto len = node.phrase.size();
+      while (pos != std::string::npos) {
+        if (count < capacity) {
+          spans[count] = {id, pos, pos + len};
+        }
+        count++;
+        pos = find_term(content, term_lower, pos + std::max<size_t>(len, 1));
+      }
+      return true;
+    }
+    case NODE_AND: {
+      auto saved = count;
+      if (!eval_with_offsets(*node.left, content, spans, capacity, count, term_id)) {
+        term_id += count_terms(*node.right);
+        count = saved;
+        return false;
+      }
+      if (!eval_with_offsets(*node.right, content, spans, capacity, count, term_id)) {
+        count = saved;
+        return false;
+      }
+      return true;
+    }
+    case NODE_OR: {
+      auto saved = count;
+      if (eval_with_offsets(*node.left, content, spans, capacity, count, term_id)) {
+        term_id += count_terms(*node.right);
+        return true;
+      }
+      count = saved;
+      if (eval_with_offsets(*node.right, content, spans, capacity, count, term_id)) {
+        return true;
+      }
+      count = saved;
+      return false;
+    }
+    default:
+      return false;
+  }
+}
+
+inline bool match_with_offsets(const std::string& content, std::string query, std::string& err,
+    match_span_t* spans, size_t capacity, size_t& count,
+    std::function<std::string(const std::string&)> apply_lookup = nullptr) {
+  count = 0;
+  if (query.empty()) {
+    return true;
+  }
+  auto tokens = tokenize_input(query, apply_lookup);
+
+  // Return true for empty token list (only EOF)
+  if (tokens.size() <= 1) {
+    return true;
+  }
+
+  auto node = parse_expression(tokens, err);
+  if (!node) {
+    return false;
+  }
+
+  size_t term_id = 0;
+  return eval_with_offsets(*node, content, spans, capacity, count, term_id);
+}
+
+// Place a window of at most width bytes at begin, shifted left if it runs
+// past the end of content. If begin falls inside a UTF-8 sequence before
+// anchor it is moved forward, otherwise back, to a lead byte, and end is moved
+// back so it does not split a sequence. begin <= end always holds.
+inline snippet_t snippet_fit(const std::string& content, size_t begin, size_t width,
+    size_t anchor = 0) {
+  auto is_continuation = [&](size_t i) {
+    return (static_cast<unsigned char>(content[i]) & 0xC0) == 0x80;
+  };
+  auto size = content.size();
+  snippet_t snippet;
+  snippet.end = std::min(size, begin + width);
+  snippet.begin = snippet.end > width ? snippet.end - width : 0;
+  while (snippet.begin < anchor && is_continuation(snippet.begin)) {
+    snippet.begin++;
+  }
+  while (snippet.begin > 0 && snippet.begin < size && is_continuation(snippet.begin)) {
+    snippet.begin--;
+  }
+  snippet.end = std::min(size, snippet.begin + width);
+  while (snippet.end > snippet.begin && snippet.end < size && is_continuation(snippet.end)) {
+    snippet.end--;
+  }
+  return snippet;
+}
+
+// Pick a window of at most width bytes that covers the most spans, and
+// center it on those hits. Boundaries are moved so that they never split a
+// UTF-8 sequence. capacity and count are the values used with
+// match_with_offsets; only the min(count, capacity) spans written are read.
+inline snippet_t snippet_window(const std::string& content,
+    const match_span_t* spans, size_t capacity, size_t count, size_t width) {
+  count = std::min(count, capacity);
+  auto size = content.size();
+  if (width >= size) {
+    return {0, size};
+  }
+  if (count == 0) {
+    return snippet_fit(content, 0, width);
+  }
+
+  // Spans are in evaluation order, not sorted, so try each span as the
+  // start of the window. The buffer is small enough for this to be cheap.
+  size_t best_hits = 0;
+  size_t best_begin = 0;
+  size_t best_end = 0;
+  for (size_t i = 0; i < count; i++) {
+    auto begin = spans[i].begin;
+    size_t hits = 0;
+    size_t end = begin;
+    for (size_t j = 0; j < count; j++) {
+      if (spans[j].begin >= begin && spans[j].end <= begin + width) {
+        hits++;
+        end = std::max(end, spans[j].end);
+      }
+    }
+    if (hits > best_hits || (hits == best_hits && begin < best_begin)) {
+      best_hits = hits;
+      best_begin = begin;
+      best_end = end;
+    }
+  }
+  if (best_hits == 0) {
+    // Every hit is wider than the window: start at the first one and cut it
+    best_begin = spans[0].begin;
+    for (size_t i = 1; i < count; i++) {
+      best_begin = std::min(best_begin, spans[i].begin);
+    }
+    return snippet_fit(content, best_begin, width);
+  }
+
+  auto pad = (width - std::min(width, best_end - best_begin)) / 2;
+  return snippet_fit(content, best_begin > pad ? best_begin - pad : 0, width, best_begin);
+}
+
 } // namespace searchquery
 
 #endif // SEARCHQUERY_BASE_HXX
@@ -165,6 +165,176 @@ test_match_complex_queries() {
   }
 }
 
+struct offsets_test_case {
+  std::string name;
+  std::string query;
+  std::string content;
+  bool want;
+  std::vector<match_span_t> want_spans;
+};
+
+static void
+test_match_with_offsets() {
+  std::vector<offsets_test_case> tests = {
+    {"single term", "hello", "Hello World", true, {{0, 0, 5}}},
+    {"repeated term", "cat", "cat and cat", true, {{0, 0, 3}, {0, 8, 11}}},
+    {"implicit AND", "hello world", "Hello World", true, {{0, 0, 5}, {1, 6, 11}}},
+    {"phrase", "\"quick brown\"", "The Quick Brown fox", true, {{0, 4, 15}}},
+    {"OR skips right side", "hello OR world", "Hello World", true, {{0, 0, 5}}},
+    {"OR keeps term ids", "mars OR world", "Hello World", true, {{1, 6, 11}}},
+    {"failed branch is discarded", "(cat AND dog) OR bird", "a cat and a bird", true, {{2, 12, 16}}},
+    {"no match", "hello mars", "Hello World", false, {}},
+  };
+
+  for (const auto &tc : tests) {
+    test_count++;
+    std::string err;
+    match_span_t spans[8];
+    size_t count = 0;
+    bool got = match_with_offsets(tc.content, tc.query, err, spans, 8, count);
+    bool ok = got == tc.want && count == tc.want_spans.size();
+    for (size_t i = 0; ok && i < count; i++) {
+      ok = spans[i].term_id == tc.want_spans[i].term_id &&
+           spans[i].begin == tc.want_spans[i].begin &&
+           spans[i].end == tc.want_spans[i].end;
+    }
+    if (ok) {
+      std::cout << "PASS: MatchWithOffsets - " << tc.name << std::endl;
+      pass_count++;
+    } else {
+      std::cout << "FAIL: MatchWithOffsets - " << tc.name << " - got " << got
+                << " with " << count << " spans, want " << tc.want << " with "
+                << tc.want_spans.size() << " spans" << std::endl;
+    }
+  }
+
+  // Output is bounded by capacity, count reports the total
+  test_count++;
+  {
+    std::string err;
+    match_span_t spans[2];
+    size_t count = 0;
+    bool got = match_with_offsets("a a a a", "a", err, spans, 2, count);
+    if (got && count == 4 && spans[1].begin == 2) {
+      std::cout << "PASS: MatchWithOffsets - truncated output" << std::endl;
+      pass_count++;
+    } else {
+      std::cout << "FAIL: MatchWithOffsets - truncated output - got " << got
+                << " with " << count << " spans" << std::endl;
+    }
+  }
+}
+
+static void
+test_eval_with_offsets_raw_content() {
+  test_count++;
+  std::string err;
+  auto node = parse_expression(tokenize_input("hello"), err);
+  match_span_t spans[2];
+  size_t count = 0;
+  size_t term_id = 0;
+  bool got = node && eval_with_offsets(*node, "Say HELLO", spans, 2, count, term_id);
+  if (got && count == 1 && spans[0].begin == 4 && spans[0].end == 9) {
+    std::cout << "PASS: EvalWithOffsets - raw content" << std::endl;
+    pass_count++;
+  } else {
+    std::cout << "FAIL: EvalWithOffsets - raw content - got " << got
+              << " with " << count << " spans" << std::endl;
+  }
+}
+
+struct snippet_test_case {
+  std::string name;
+  std::string content;
+  std::vector<match_span_t> spans;
+  size_t width;
+  std::string want;
+};
+
+static bool
+is_boundary(const std::string &content, size_t pos) {
+  return pos == content.size() ||
+         (static_cast<unsigned char>(content[pos]) & 0xC0) != 0x80;
+}
+
+static void
+test_snippet_window() {
+  std::string content = "cat at the start, then a long stretch of filler text, "
+                        "then a dog and a bird close together";
+  std::string err;
+  match_span_t spans[8];
+  size_t count = 0;
+  match_with_offsets(content, "(cat dog bird)", err, spans, 8, count);
+
+  test_count++;
+  auto snippet = snippet_window(content, spans, 8, count, 30);
+  auto text = content.substr(snippet.begin, snippet.end - snippet.begin);
+  if (snippet.end - snippet.begin == 30 &&
+      text.find("dog") != std::string::npos &&
+      text.find("bird") != std::string::npos) {
+    std::cout << "PASS: SnippetWindow - densest cluster" << std::endl;
+    pass_count++;
+  } else {
+    std::cout << "FAIL: SnippetWindow - densest cluster - got \"" << text << "\"" << std::endl;
+  }
+
+  test_count++;
+  snippet = snippet_window(content, spans, 8, count, 1000);
+  if (snippet.begin == 0 && snippet.end == content.size()) {
+    std::cout << "PASS: SnippetWindow - wider than content" << std::endl;
+    pass_count++;
+  } else {
+    std::cout << "FAIL: SnippetWindow - wider than content" << std::endl;
+  }
+
+  // count above capacity only reads the spans that were written
+  test_count++;
+  {
+    match_span_t few[2];
+    size_t total = 0;
+    match_with_offsets("a a a a", "a", err, few, 2, total);
+    snippet = snippet_window("a a a a", few, 2, total, 3);
+    if (total == 4 && snippet.begin == 0 && snippet.end == 3) {
+      std::cout << "PASS: SnippetWindow - truncated spans" << std::endl;
+      pass_count++;
+    } else {
+      std::cout << "FAIL: SnippetWindow - truncated spans - got {" << snippet.begin
+                << ", " << snippet.end << "}" << std::endl;
+    }
+  }
+
+  std::vector<snippet_test_case> tests = {
+    {"no hits", "abcdef", {}, 3, "abc"},
+    {"no hits cuts before UTF-8 sequence", "ab\xE2\x82\xAC" "cd", {}, 3, "ab"},
+    {"hit in UTF-8 sequence", "a\xE2\x82\xAC" "bcd", {{0, 2, 3}}, 1, ""},
+    {"hit on UTF-8 sequence", "ab\xE2\x82\xAC" "cdefgh", {{0, 2, 5}}, 4, "\xE2\x82\xAC" "c"},
+    {"padding starts in UTF-8 sequence", std::string(20, 'x') + "\xE2\x82\xAC" "abcdefgh" + std::string(20, 'y'),
+     {{0, 23, 31}}, 10, "abcdefghyy"},
+    {"hit wider than window", std::string(50, 'x') + "hello", {{0, 50, 55}}, 3, "hel"},
+  };
+
+  for (const auto &tc : tests) {
+    test_count++;
+    auto snippet = snippet_window(tc.content, tc.spans.data(), tc.spans.size(), tc.spans.size(), tc.width);
+    bool ok = snippet.begin <= snippet.end && snippet.end <= tc.content.size() &&
+              snippet.end - snippet.begin <= tc.width &&
+              is_boundary(tc.content, snippet.begin) && is_boundary(tc.content, snippet.end);
+    std::string text;
+    if (ok) {
+      text = tc.content.substr(snippet.begin, snippet.end - snippet.begin);
+      ok = text == tc.want;
+    }
+    if (ok) {
+      std::cout << "PASS: SnippetWindow - " << tc.name << std::endl;
+      pass_count++;
+    } else {
+      std::cout << "FAIL: SnippetWindow - " << tc.name << " - got {" << snippet.begin
+                << ", " << snippet.end << "} \"" << text << "\", want \"" << tc.want
+                << "\"" << std::endl;
+    }
+  }
+}
+
 struct tsquery_test_case {
   std::string name;
   std::string query;
@@ -234,6 +404,9 @@ main() {
   test_match_parentheses();
   test_match_edge_cases();
   test_match_complex_queries();
+  test_match_with_offsets();
+  test_eval_with_offsets_raw_content();
+  test_snippet_window();
   test_to_tsquery();
   test_to_fts5_query();
   